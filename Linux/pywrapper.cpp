@@ -19,6 +19,9 @@
  */
 
 #include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
 #include "pywrapper.h"
 
 using std::runtime_error;
@@ -33,14 +36,22 @@ Object::Object(PyObject *obj) : py_obj(make_pyshared(obj)) {
     
 }
 
+Object::Object(PyObject *obj, const pyshared_ptr &owner) 
+: owner(owner), py_obj(make_pyshared(obj)) {
+    
+}
+
 Python::Object::pyshared_ptr Object::make_pyshared(PyObject *obj) {
     return pyshared_ptr(obj, [](PyObject *obj) { Py_XDECREF(obj); });
 }
 
-Object Object::from_script(const string &script_path) {
+/* Splits the script path into its directory and module name, and adds
+ * that directory to sys.path so the module can be imported. */
+static void add_script_dir(const string &script_path, string &base_path, 
+  string &file_path) {
     char arr[] = "path";
     PyObject *path(PySys_GetObject(arr));
-    string base_path("."), file_path;
+    base_path = ".";
     size_t last_slash(script_path.rfind("/"));
     if(last_slash != string::npos) {
         if(last_slash >= script_path.size() - 2)
@@ -56,6 +67,11 @@ Object Object::from_script(const string &script_path) {
     
     PyList_Append(path, pwd.get());
     /* We don't need that string value anymore, so deref it */
+}
+
+Object Object::from_script(const string &script_path) {
+    string base_path, file_path;
+    add_script_dir(script_path, base_path, file_path);
     PyObject *py_ptr(PyImport_ImportModule(file_path.c_str()));
     if(!py_ptr) {
         print_error();
@@ -76,14 +92,14 @@ Object Object::call_function(const std::string &name) {
     PyObject *ret(PyObject_CallObject(func.get(), 0));
     if(!ret)
         throw std::runtime_error("Failed to call function");
-    return {ret};
+    return Object(ret, owner);
 }
 
 Object Object::get_attr(const std::string &name) {
     PyObject *obj(PyObject_GetAttrString(py_obj.get(), name.c_str()));
     if(!obj)
         throw std::runtime_error("Unable to find attribute '" + name + '\'');
-    return {obj};
+    return Object(obj, owner);
 }
 
 bool Object::has_attr(const std::string &name) {
@@ -95,11 +111,80 @@ bool Object::has_attr(const std::string &name) {
     }
 }
 
+// ReloadableScript
+
+ReloadableScript::ReloadableScript(const string &script_path) 
+: last_version(0) {
+    string base_path;
+    add_script_dir(script_path, base_path, module_name);
+    source_path = base_path + "/" + module_name + ".py";
+    reload();
+}
+
+ReloadableScript::version_ptr ReloadableScript::current() const {
+    return std::atomic_load(&script);
+}
+
+unsigned ReloadableScript::version() const {
+    return current()->number;
+}
+
+void ReloadableScript::reload() {
+    std::ifstream input(source_path.c_str());
+    if(!input)
+        throw runtime_error("Failed to open script " + source_path);
+    std::ostringstream source;
+    source << input.rdbuf();
+    
+    /* Running the module body may release the GIL and let another 
+     * reload in, so numbers come from a counter rather than current() */
+    unsigned new_version(++last_version);
+    std::ostringstream name;
+    name << module_name << "__v" << new_version;
+    pyunique_ptr code(Py_CompileString(source.str().c_str(), 
+        source_path.c_str(), Py_file_input));
+    if(!code) {
+        print_error();
+        throw runtime_error("Failed to compile script " + source_path);
+    }
+    PyObject *py_ptr(PyImport_ExecCodeModuleEx(
+        const_cast<char*>(name.str().c_str()), code.get(), 
+        const_cast<char*>(source_path.c_str())
+    ));
+    if(!py_ptr) {
+        print_error();
+        throw runtime_error("Failed to load script " + source_path);
+    }
+    /* Keep the module out of sys.modules, so the last version_ptr 
+     * pointing to it is the one that frees it */
+    if(PyDict_DelItemString(PyImport_GetModuleDict(), name.str().c_str()))
+        clear_error();
+    /* Everything obtained from this version keeps the module alive */
+    Object module(py_ptr);
+    module.owner = module.py_obj;
+    version_ptr loaded(std::make_shared<Version>(module, new_version));
+    /* Never replace a newer version that finished loading first */
+    version_ptr expected(current());
+    while(!expected || expected->number < new_version) {
+        if(std::atomic_compare_exchange_weak(&script, &expected, loaded))
+            break;
+    }
+}
+
+static void load_gc_functions();
+static void release_gc_functions();
+
 void initialize() {
     Py_Initialize();
+    try {
+        load_gc_functions();
+    } catch(std::runtime_error&) {
+        /* Retried, and reported, by the first gc_* call */
+    }
 }
 
 void finalize() {
+    release_gc_functions();
     Py_Finalize();
 }
 
@@ -115,6 +200,119 @@ void print_object(PyObject *obj) {
     PyObject_Print(obj, stdout, 0);
 }
 
+// Garbage collector scheduling
+
+static GCStats collector_stats;
+
+/* The gc module's functions, looked up once so that pausing and 
+ * resuming collections costs a single call each. freeze stays null
+ * on interpreters that don't have it. */
+static struct {
+    PyObject *enable, *disable, *isenabled, *freeze;
+} gc_functions = { 0, 0, 0, 0 };
+
+static PyObject *load_gc_function(PyObject *gc, const char *name) {
+    PyObject *func(PyObject_GetAttrString(gc, name));
+    if(!func)
+        clear_error();
+    return func;
+}
+
+static void load_gc_functions() {
+    if(gc_functions.enable)
+        return;
+    pyunique_ptr gc(PyImport_ImportModule("gc"));
+    if(!gc) {
+        clear_error();
+        throw runtime_error("Failed to import gc");
+    }
+    gc_functions.disable = load_gc_function(gc.get(), "disable");
+    gc_functions.isenabled = load_gc_function(gc.get(), "isenabled");
+    gc_functions.freeze = load_gc_function(gc.get(), "freeze");
+    gc_functions.enable = load_gc_function(gc.get(), "enable");
+}
+
+static void release_gc_functions() {
+    Py_CLEAR(gc_functions.enable);
+    Py_CLEAR(gc_functions.disable);
+    Py_CLEAR(gc_functions.isenabled);
+    Py_CLEAR(gc_functions.freeze);
+}
+
+static pyunique_ptr call_gc_function(PyObject *func, const char *name) {
+    PyObject *ret(func ? PyObject_CallObject(func, 0) : 0);
+    if(!ret)
+        throw runtime_error(string("Failed to call gc.") + name);
+    return pyunique_ptr(ret);
+}
+
+bool gc_freeze() {
+    load_gc_functions();
+    if(!gc_functions.freeze)
+        return false;
+    call_gc_function(gc_functions.freeze, "freeze");
+    return true;
+}
+
+void gc_disable() {
+    load_gc_functions();
+    call_gc_function(gc_functions.disable, "disable");
+}
+
+void gc_enable() {
+    load_gc_functions();
+    call_gc_function(gc_functions.enable, "enable");
+}
+
+bool gc_is_enabled() {
+    load_gc_functions();
+    bool enabled;
+    if(!convert(call_gc_function(gc_functions.isenabled, "isenabled").get(), enabled))
+        throw runtime_error("gc.isenabled returned a non bool value");
+    return enabled;
+}
+
+Py_ssize_t gc_collect() {
+    auto start(std::chrono::steady_clock::now());
+    Py_ssize_t unreachable(PyGC_Collect());
+    std::chrono::duration<double, std::milli> pause(
+        std::chrono::steady_clock::now() - start
+    );
+    collector_stats.collections++;
+    collector_stats.last_pause_ms = pause.count();
+    collector_stats.total_pause_ms += pause.count();
+    collector_stats.max_pause_ms = std::max(collector_stats.max_pause_ms, pause.count());
+    return unreachable;
+}
+
+const GCStats &gc_stats() {
+    return collector_stats;
+}
+
+void gc_reset_stats() {
+    collector_stats = GCStats();
+}
+
+GCPause::GCPause() : was_enabled(gc_is_enabled()) {
+    if(was_enabled)
+        gc_disable();
+}
+
+GCPause::~GCPause() {
+    if(!was_enabled)
+        return;
+    /* This may run while unwinding from a failed call, so keep its 
+     * error aside and never let an exception out of here */
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    try {
+        gc_enable();
+    } catch(std::runtime_error&) {
+        clear_error();
+    }
+    PyErr_Restore(type, value, traceback);
+}
+
 // Allocation methods
 
 PyObject *alloc_pyobject(const std::string &str) {
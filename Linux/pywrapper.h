@@ -29,6 +29,7 @@
 #include <vector>
 #include <list>
 #include <tuple>
+#include <atomic>
 #include <python2.7/Python.h>
 
 
@@ -99,14 +100,76 @@ namespace Python {
         }
         return true;
     }
+    // Element types whose lists can be unpacked without going through
+    // convert() for each item.
+    template<class T, class Enable = void>
+    struct list_fast_path {
+        typedef std::false_type enabled;
+    };
+    
+    template<>
+    struct list_fast_path<double> {
+        typedef std::true_type enabled;
+        static bool check(PyObject *obj) { return PyFloat_CheckExact(obj); }
+        static double unpack(PyObject *obj) { return PyFloat_AS_DOUBLE(obj); }
+    };
+    
+    template<class T>
+    struct list_fast_path<T, typename std::enable_if<
+      std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+        typedef std::true_type enabled;
+        static bool check(PyObject *obj) { return PyInt_CheckExact(obj); }
+        static T unpack(PyObject *obj) { return PyInt_AS_LONG(obj); }
+    };
+    
+    // Appends the unpacked items to a generic container.
+    template<class T, class C>
+    void append_unpacked(PyObject **items, Py_ssize_t size, C &container) {
+        for(Py_ssize_t i(0); i < size; ++i)
+            container.push_back(list_fast_path<T>::unpack(items[i]));
+    }
+    
+    // Appends the unpacked items to a std::vector, presized so the loop
+    // only does the loads and stores.
+    template<class T>
+    void append_unpacked(PyObject **items, Py_ssize_t size, std::vector<T> &vec) {
+        size_t offset(vec.size());
+        vec.resize(offset + size);
+        T *out(vec.data() + offset);
+        for(Py_ssize_t i(0); i < size; ++i)
+            out[i] = list_fast_path<T>::unpack(items[i]);
+    }
+    
+    template<class T, class C>
+    bool unpack_list(PyObject *, C &, std::false_type) {
+        return false;
+    }
+    
+    // Unpacks the list if every item has exactly the fast path's type.
+    // Returns false, leaving the container untouched, otherwise.
+    template<class T, class C>
+    bool unpack_list(PyObject *obj, C &container, std::true_type) {
+        PyObject **items(((PyListObject*)obj)->ob_item);
+        const Py_ssize_t size(PyList_GET_SIZE(obj));
+        for(Py_ssize_t i(0); i < size; ++i) {
+            if(!list_fast_path<T>::check(items[i]))
+                return false;
+        }
+        append_unpacked<T>(items, size, container);
+        return true;
+    }
+    
     // Convert a PyObject to a generic container.
     template<class T, class C>
     bool convert_list(PyObject *obj, C &container) {
         if(!PyList_Check(obj))
             return false;
-        for(Py_ssize_t i(0); i < PyList_Size(obj); ++i) {
+        if(unpack_list<T>(obj, container, typename list_fast_path<T>::enabled()))
+            return true;
+        const Py_ssize_t size(PyList_GET_SIZE(obj));
+        for(Py_ssize_t i(0); i < size; ++i) {
             T val;
-            if(!convert(PyList_GetItem(obj, i), val))
+            if(!convert(PyList_GET_ITEM(obj, i), val))
                 return false;
             container.push_back(std::move(val));
         }
@@ -134,15 +197,7 @@ namespace Python {
     // -------------- PyObject allocators ----------------
     
     // Generic python list allocation
-    template<class T> static PyObject *alloc_list(const T &container) {
-        PyObject *lst(PyList_New(container.size()));
-            
-        Py_ssize_t i(0);
-        for(auto it(container.begin()); it != container.end(); ++it)
-            PyList_SetItem(lst, i++, alloc_pyobject(*it));
-        
-        return lst;
-    }
+    template<class T> static PyObject *alloc_list(const T &container);
     // Creates a PyObject from a std::string
     PyObject *alloc_pyobject(const std::string &str);
     // Creates a PyObject from a std::vector<char>
@@ -182,6 +237,20 @@ namespace Python {
         return dict;
     }
     
+    // The list is brand new and presized, so items are placed without 
+    // PyList_SetItem's checks.
+    template<class T> static PyObject *alloc_list(const T &container) {
+        PyObject *lst(PyList_New(container.size()));
+        if(!lst)
+            return 0;
+        
+        Py_ssize_t i(0);
+        for(auto it(container.begin()); it != container.end(); ++it)
+            PyList_SET_ITEM(lst, i++, alloc_pyobject(*it));
+        
+        return lst;
+    }
+    
     void initialize();
     void finalize();
     void print_error();
@@ -230,7 +299,7 @@ namespace Python {
             PyObject *ret(PyObject_CallObject(func.get(), tup.get()));
             if(!ret)
                 throw std::runtime_error("Failed to call function " + name);
-            return {ret};
+            return Object(ret, owner);
         }
         
         /**
@@ -291,7 +360,11 @@ namespace Python {
          */
         static Object from_script(const std::string &script_path);
     private:
+        friend class ReloadableScript;
+        
         typedef std::shared_ptr<PyObject> pyshared_ptr;
+        
+        Object(PyObject *obj, const pyshared_ptr &owner);
     
         PyObject *load_function(const std::string &name);
         
@@ -332,8 +405,147 @@ namespace Python {
             PyTuple_SetItem(tup.get(), i, alloc_pyobject(data));
         }
         
+        // Kept alive as long as this Object and everything obtained 
+        // from it. Declared first so it's released after py_obj.
+        pyshared_ptr owner;
         pyshared_ptr py_obj;
     };
+    
+    /**
+     * \class ReloadableScript
+     * \brief A script that can be reloaded while calls into it are 
+     * still running.
+     * 
+     * Every load imports the file as a new module next to the previous
+     * ones and atomically makes it the current version. Calls take a
+     * reference to the version that was current when they started.
+     * 
+     * Objects obtained from a version, either results of call_function
+     * or attributes, and anything obtained from those in turn, keep 
+     * that version's module alive. They remain usable after a reload;
+     * the module is only released once it's been replaced and the last
+     * of them is gone. Raw PyObject* taken out of them through 
+     * Object::get aren't tracked, so they must not outlive the Object
+     * they came from: on Python 2 releasing a module sets its globals 
+     * to None. As with every other Object, the GIL must be held while 
+     * using it.
+     */
+    class ReloadableScript {
+    public:
+        // A loaded version of the script.
+        struct Version {
+            Version(const Object &script, unsigned number) 
+            : script(script), number(number) { }
+            
+            Object script;
+            const unsigned number;
+        };
+        
+        typedef std::shared_ptr<Version> version_ptr;
+        
+        /**
+         * \brief Loads the first version of a script.
+         * 
+         * If any errors are encountered while loading this script, a
+         * std::runtime_error is thrown.
+         * 
+         * \param script_path The path of the script to be loaded.
+         */
+        ReloadableScript(const std::string &script_path);
+        
+        /**
+         * \brief Returns the current version of the script.
+         * 
+         * Hold on to the returned pointer for the whole call, so a 
+         * concurrent reload doesn't release the module under it.
+         */
+        version_ptr current() const;
+        
+        /**
+         * \brief Loads the script file again and makes it the current
+         * version.
+         * 
+         * Calls already in flight keep using the version they started
+         * with. If the new version fails to load, a std::runtime_error 
+         * is thrown and the current version is kept.
+         * 
+         * Reloads may overlap, since running the script can release the
+         * GIL. Each one loads its own module under its own version 
+         * number, and a version that finishes after a newer one is
+         * discarded instead of made current.
+         */
+        void reload();
+        
+        /**
+         * \brief Returns the number of the current version, starting 
+         * from 1.
+         */
+        unsigned version() const;
+        
+        /**
+         * \brief Calls the callable attribute "name" of the current 
+         * version.
+         * 
+         * \sa Python::Object::call_function.
+         */
+        template<typename... Args>
+        Object call_function(const std::string &name, const Args&... args) {
+            version_ptr script(current());
+            return script->script.call_function(name, args...);
+        }
+    private:
+        std::string source_path, module_name;
+        std::atomic<unsigned> last_version;
+        version_ptr script;
+    };
+    
+    // -------------- Garbage collector scheduling ----------------
+    
+    // Pause times of the collections run through gc_collect.
+    struct GCStats {
+        GCStats() : collections(0), total_pause_ms(0), max_pause_ms(0), 
+          last_pause_ms(0) { }
+        
+        size_t collections;
+        double total_pause_ms, max_pause_ms, last_pause_ms;
+    };
+    
+    // Moves every object allocated so far to a permanent generation that
+    // collections skip. Meant to be called after loading the scripts. 
+    // Returns false if the interpreter has no gc.freeze(3.7 onwards).
+    bool gc_freeze();
+    // Stops automatic collections. gc_collect keeps working.
+    void gc_disable();
+    // Resumes automatic collections.
+    void gc_enable();
+    // Indicates whether automatic collections are enabled.
+    bool gc_is_enabled();
+    // Runs a full collection right away and records its pause time.
+    // Returns the number of unreachable objects found.
+    Py_ssize_t gc_collect();
+    // Returns the pause times recorded by gc_collect.
+    const GCStats &gc_stats();
+    // Clears the pause times recorded by gc_collect.
+    void gc_reset_stats();
+    
+    /**
+     * \class GCPause
+     * \brief Suspends automatic collections while in scope.
+     * 
+     * Wrap latency critical calls with it, then run gc_collect at an
+     * idle point. The previous collector state is restored on 
+     * destruction, so GCPause objects can be nested.
+     */
+    class GCPause {
+    public:
+        GCPause();
+        ~GCPause();
+    private:
+        GCPause(const GCPause&);
+        GCPause &operator=(const GCPause&);
+        
+        bool was_enabled;
+    };
 };
 
 #endif // PYWRAPPER_H
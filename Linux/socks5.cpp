@@ -28,7 +28,24 @@
 #include <netinet/in.h>
 #include <netdb.h>
 
+/* TRANSPARENT_PROXY expects the traffic to be diverted by iptables, e.g.
+ *   iptables -t nat -A OUTPUT -p tcp -s <client> -j REDIRECT --to-ports 5555
+ *   iptables -t mangle -A PREROUTING -p tcp -s <client> -j TPROXY --on-port 5555
+ * The rule must not match the proxy's own outgoing connections */
+#ifdef TRANSPARENT_PROXY
+    #include <linux/netfilter_ipv4.h>
+#endif
+
+#ifdef HANDOFF_SIBLINGS
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+#endif
+
 #include <pthread.h>
+#include <time.h>
 
 #include <iostream>
 #include <memory>
@@ -42,12 +59,21 @@
 #endif
 #define MAXPENDING 200
 #define BUF_SIZE 256
+#define HTTP_MAX_HEADER 4096
 #ifndef USERNAME
     #define USERNAME "username"
 #endif
 #ifndef PASSWORD
     #define PASSWORD "password"
 #endif
+/* Private (0700) directory holding the load file and handoff sockets */
+#ifndef HANDOFF_DIR
+    #define HANDOFF_DIR "/tmp/socks5-handoff"
+#endif
+#define HANDOFF_RETRY_MS 50
+#ifndef IPPROTO_MPTCP
+    #define IPPROTO_MPTCP 262
+#endif
 
 
 using namespace std;
@@ -72,6 +98,10 @@ using namespace std;
 #define RESP_SUCCEDED       0
 #define RESP_GEN_ERROR      1
 
+/* SOCKS4 responses */
+#define RESP4_GRANTED       0x5a
+#define RESP4_REJECTED      0x5b
+
 
 /* Handshake */
 
@@ -114,6 +144,25 @@ struct SOCKS5Response {
 } __attribute__((packed));
 
 
+/* SOCKS4/4a */
+
+struct SOCKS4RequestHeader {
+    uint8_t version, cmd;
+    uint16_t port;
+    uint32_t ip_dst;
+    /* char userid[]; terminated by a null byte */
+    /* char dname[]; SOCKS4a only, when ip_dst is 0.0.0.x */
+} __attribute__((packed));
+
+struct SOCKS4Response {
+    uint8_t version /* = 0x00 */, cmd;
+    uint16_t port;
+    uint32_t ip;
+    
+    SOCKS4Response(bool granted = true) : version(0), cmd(granted ? RESP4_GRANTED : RESP4_REJECTED), port(0), ip(0) { }
+} __attribute__((packed));
+
+
 class Lock {
 	pthread_mutex_t mutex;
 public:
@@ -167,6 +216,18 @@ public:
 	inline void wait(){
         pthread_cond_wait(&condition, &mutex);
     }
+    
+	inline void timed_wait(unsigned ms) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (ms % 1000) * 1000000;
+        if(ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&condition, &mutex, &ts);
+    }
 };
 
 
@@ -174,6 +235,18 @@ Lock get_host_lock;
 Event client_lock;
 uint32_t client_count = 0, max_clients = 10;
 
+#ifdef HANDOFF_SIBLINGS
+/* Load figures of every sibling, kept in a file all of them map */
+struct SiblingLoad {
+    volatile uint32_t clients, max_clients;
+    volatile pid_t pid; /* 0 until the sibling is ready to take clients */
+};
+
+SiblingLoad *sibling_loads = 0;
+int handoff_sock = -1;
+uint32_t instance_id = 0;
+#endif
+
 void sig_handler(int signum) {
     
 }
@@ -191,6 +264,17 @@ int create_listen_socket(struct sockaddr_in &echoclient) {
     echoserver.sin_family = AF_INET;                  /* Internet/IP */
     echoserver.sin_addr.s_addr = htonl(INADDR_ANY);   /* Incoming addr */
     echoserver.sin_port = htons(SERVER_PORT);       /* server port */
+    #ifdef HANDOFF_SIBLINGS
+        /* Every sibling listens on the same port */
+        int reuse = 1;
+        setsockopt(serversock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+    #endif
+    #ifdef TRANSPARENT_PROXY
+        /* TPROXY delivers connections addressed to foreign IPs */
+        int one = 1;
+        if (setsockopt(serversock, SOL_IP, IP_TRANSPARENT, &one, sizeof(one)) < 0)
+            cout << "[-] Could not set IP_TRANSPARENT, only REDIRECT will work.\n";
+    #endif
     /* Bind the server socket */
     if (bind(serversock, (struct sockaddr *) &echoserver, sizeof(echoserver)) < 0) {
         cout << "[-] Bind error.\n";
@@ -236,10 +320,48 @@ string int_to_str(uint32_t ip) {
     return oss.str();
 }
 
+string base64_encode(const string &data) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    string output;
+    for (size_t i = 0; i < data.size(); i += 3) {
+        uint32_t chunk = (uint8_t)data[i] << 16;
+        if(i + 1 < data.size())
+            chunk |= (uint8_t)data[i + 1] << 8;
+        if(i + 2 < data.size())
+            chunk |= (uint8_t)data[i + 2];
+        output += alphabet[(chunk >> 18) & 0x3f];
+        output += alphabet[(chunk >> 12) & 0x3f];
+        output += (i + 1 < data.size()) ? alphabet[(chunk >> 6) & 0x3f] : '=';
+        output += (i + 2 < data.size()) ? alphabet[chunk & 0x3f] : '=';
+    }
+    return output;
+}
+
+bool resolve_host(const char *host, uint32_t &ip) {
+    get_host_lock.lock();
+    struct hostent *server = gethostbyname(host);
+    if(!server || server->h_addrtype != AF_INET) {
+        get_host_lock.unlock();
+        return false;
+    }
+    memcpy(&ip, server->h_addr, sizeof(ip));
+    get_host_lock.unlock();
+    return true;
+}
+
 int connect_to_host(uint32_t ip, uint16_t port) {
     struct sockaddr_in serv_addr;
     struct hostent *server;
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    #ifdef UPSTREAM_MPTCP
+        /* Subflows over the other egress paths are opened by the kernel
+         * path manager ("ip mptcp endpoint ... subflow"). Kernels without
+         * MPTCP get plain TCP, and so do peers that don't support it. */
+        int sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_MPTCP);
+        if (sockfd < 0)
+            sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    #else
+        int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    #endif
     if (sockfd < 0)
         return -1;
     bzero((char *) &serv_addr, sizeof(serv_addr));
@@ -337,65 +459,450 @@ void do_proxy(int client, int conn, char *buffer) {
     }
 }
 
+/* Common tail of every protocol: connects to the destination, sends 
+ * the protocol specific success or failure reply (if any) and relays
+ * the data. */
+bool relay_to_host(int sock, uint32_t ip, uint16_t port, char *buffer, const char *reply, uint32_t reply_size, 
+  const char *failure, uint32_t failure_size) {
+    #ifdef OPTIMISTIC_CONNECT
+        /* Reply before connecting. Whatever the client sends meanwhile
+         * waits in the socket's receive buffer until do_proxy picks it
+         * up; if the connect fails the tunnel is just closed. */
+        send_sock(sock, reply, reply_size);
+    #endif
+    int client_sock = connect_to_host(ip, port);
+    if(client_sock == -1) {
+        #ifndef OPTIMISTIC_CONNECT
+            send_sock(sock, failure, failure_size);
+        #endif
+        return false;
+    }
+    #ifndef OPTIMISTIC_CONNECT
+        send_sock(sock, reply, reply_size);
+    #endif
+    do_proxy(client_sock, sock, buffer);
+    shutdown(client_sock, SHUT_RDWR);
+    close(client_sock);
+    return true;
+}
+
 bool handle_request(int sock, char *buffer) {
     SOCKS5RequestHeader header;
     recv_sock(sock, (char*)&header, sizeof(SOCKS5RequestHeader));
     if(header.version != 5 || header.cmd != CMD_CONNECT || header.rsv != 0)
         return false;
-    int client_sock = -1;
+    SOCK5IP4RequestBody req;
     switch(header.atyp) {
         case ATYP_IPV4:
-        {
-            SOCK5IP4RequestBody req;
             if(recv_sock(sock, (char*)&req, sizeof(SOCK5IP4RequestBody)) != sizeof(SOCK5IP4RequestBody))
                 return false;
-            client_sock = connect_to_host(req.ip_dst, ntohs(req.port));
             break;
-        }
         case ATYP_DNAME:
-            break;
         default:
             return false;
     }
-    if(client_sock == -1)
-        return false;
     SOCKS5Response response;
     response.ip_src = 0;
     response.port_src = SERVER_PORT;
-    send_sock(sock, (const char*)&response, sizeof(SOCKS5Response));
-    do_proxy(client_sock, sock, buffer);
-    shutdown(client_sock, SHUT_RDWR);
-    close(client_sock);
-    return true;
+    return relay_to_host(sock, req.ip_dst, ntohs(req.port), buffer, (const char*)&response, sizeof(SOCKS5Response), 0, 0);
+}
+
+int read_null_string(int sock, char *buffer, uint32_t max_sz) {
+    for(uint32_t i(0); i < max_sz; ++i) {
+        if(recv_sock(sock, &buffer[i], 1) != 1)
+            return -1;
+        if(!buffer[i])
+            return i;
+    }
+    return -1;
+}
+
+bool reject_socks4(int sock) {
+    SOCKS4Response response(false);
+    send_sock(sock, (const char*)&response, sizeof(SOCKS4Response));
+    return false;
+}
+
+bool handle_socks4_request(int sock, char *buffer) {
+    SOCKS4RequestHeader header;
+    if(recv_sock(sock, (char*)&header, sizeof(SOCKS4RequestHeader)) != sizeof(SOCKS4RequestHeader))
+        return false;
+    if(header.version != 4 || header.cmd != CMD_CONNECT)
+        return reject_socks4(sock);
+    /* SOCKS4 can't carry a password, so only serve it when the SOCKS5
+     * side accepts unauthenticated clients as well. */
+    #ifndef ALLOW_NO_AUTH
+        return reject_socks4(sock);
+    #endif
+    if(read_null_string(sock, buffer, BUF_SIZE) == -1)
+        return reject_socks4(sock);
+    uint32_t ip = header.ip_dst;
+    /* 0.0.0.x means a SOCKS4a domain name follows the user id */
+    if((ntohl(ip) & 0xffffff00) == 0 && ip != 0) {
+        if(read_null_string(sock, buffer, BUF_SIZE) == -1 || !resolve_host(buffer, ip))
+            return reject_socks4(sock);
+    }
+    SOCKS4Response response, rejected(false);
+    return relay_to_host(sock, ip, ntohs(header.port), buffer, (const char*)&response, sizeof(SOCKS4Response), 
+        (const char*)&rejected, sizeof(SOCKS4Response));
+}
+
+/* Reads the request up to the empty line, one byte at a time so 
+ * that nothing the client sends after it is consumed. */
+bool read_http_header(int sock, string &header) {
+    char c;
+    while(header.size() < HTTP_MAX_HEADER) {
+        if(recv_sock(sock, &c, 1) != 1)
+            return false;
+        header += c;
+        if(header.size() >= 4 && !header.compare(header.size() - 4, 4, "\r\n\r\n"))
+            return true;
+    }
+    return false;
+}
+
+bool check_http_auth(const string &header) {
+    #ifdef ALLOW_NO_AUTH
+        return true;
+    #endif
+    string expected = "basic " + base64_encode(USERNAME ":" PASSWORD);
+    istringstream lines(header);
+    string line;
+    while(getline(lines, line)) {
+        size_t colon = line.find(':');
+        if(colon == string::npos)
+            continue;
+        string name = line.substr(0, colon), value = line.substr(colon + 1);
+        transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if(name != "proxy-authorization")
+            continue;
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+        /* The scheme is case insensitive, the credentials aren't */
+        transform(value.begin(), value.begin() + min<size_t>(value.size(), 5), value.begin(), ::tolower);
+        return value == expected;
+    }
+    return false;
 }
 
+#define HTTP_BAD_REQUEST    "HTTP/1.1 400 Bad Request\r\n\r\n"
+#define HTTP_DENIED         "HTTP/1.1 407 Proxy Authentication Required\r\n" \
+                            "Proxy-Authenticate: Basic realm=\"proxy\"\r\n\r\n"
+#define HTTP_BAD_GATEWAY    "HTTP/1.1 502 Bad Gateway\r\n\r\n"
+#define HTTP_ESTABLISHED    "HTTP/1.1 200 Connection established\r\n\r\n"
+
+bool reject_http(int sock, const char *response) {
+    send_sock(sock, response, strlen(response));
+    return false;
+}
+
+bool handle_http_request(int sock, char *buffer) {
+    string header, method, target, version;
+    if(!read_http_header(sock, header))
+        return reject_http(sock, HTTP_BAD_REQUEST);
+    istringstream request(header);
+    request >> method >> target >> version;
+    size_t colon = target.rfind(':');
+    if(method != "CONNECT" || version.compare(0, 5, "HTTP/") || colon == string::npos)
+        return reject_http(sock, HTTP_BAD_REQUEST);
+    if(!check_http_auth(header))
+        return reject_http(sock, HTTP_DENIED);
+    uint32_t ip;
+    int port = atoi(target.c_str() + colon + 1);
+    if(port <= 0 || port > 0xffff)
+        return reject_http(sock, HTTP_BAD_REQUEST);
+    if(!resolve_host(target.substr(0, colon).c_str(), ip))
+        return reject_http(sock, HTTP_BAD_GATEWAY);
+    return relay_to_host(sock, ip, port, buffer, HTTP_ESTABLISHED, strlen(HTTP_ESTABLISHED), 
+        HTTP_BAD_GATEWAY, strlen(HTTP_BAD_GATEWAY));
+}
+
+/* Identifies the protocol from the first byte, without consuming it */
+bool handle_client(int sock, char *buffer) {
+    uint8_t version;
+    if(recv(sock, &version, 1, MSG_PEEK) != 1)
+        return false;
+    switch(version) {
+        case 5:
+            return handle_handshake(sock, buffer) && handle_request(sock, buffer);
+        case 4:
+            return handle_socks4_request(sock, buffer);
+        case 'C':
+            return handle_http_request(sock, buffer);
+        default:
+            return false;
+    }
+}
+
+#ifdef TRANSPARENT_PROXY
+/* An address is local if a plain (non transparent) socket can bind it */
+bool is_local_address(struct in_addr addr) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if(sock < 0)
+        return true;
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr = addr;
+    bool bound = !bind(sock, (struct sockaddr *) &local, sizeof(local));
+    close(sock);
+    return bound;
+}
+
+bool get_original_dst(int sock, struct sockaddr_in &dst) {
+    socklen_t len = sizeof(dst);
+    /* REDIRECT rewrites the destination, conntrack keeps the original one.
+     * TPROXY leaves it untouched, so the local address is the original one */
+    if(getsockopt(sock, SOL_IP, SO_ORIGINAL_DST, &dst, &len)) {
+        len = sizeof(dst);
+        if(getsockname(sock, (struct sockaddr*)&dst, &len) < 0 || dst.sin_family != AF_INET)
+            return false;
+    }
+    /* A connection made directly to us would otherwise loop back here, 
+     * and conntrack reports those as well */
+    return dst.sin_port != htons(SERVER_PORT) || !is_local_address(dst.sin_addr);
+}
+
+bool handle_transparent(int sock, char *buffer) {
+    struct sockaddr_in dst;
+    if(!get_original_dst(sock, dst))
+        return false;
+    return relay_to_host(sock, dst.sin_addr.s_addr, ntohs(dst.sin_port), buffer, 0, 0, 0, 0);
+}
+#endif
+
 void *handle_connection(void *arg) {
     int sock = (uint64_t)arg;
     char *buffer = new char[BUF_SIZE];
-    if(handle_handshake(sock, buffer))
-        handle_request(sock, buffer);
+    #ifdef TRANSPARENT_PROXY
+        handle_transparent(sock, buffer);
+    #else
+        handle_client(sock, buffer);
+    #endif
     shutdown(sock, SHUT_RDWR);
     close(sock);
     delete[] buffer;
     client_lock.lock();
     client_count--;
-    if(client_count == max_clients - 1)
-        client_lock.signal();
+    #ifdef HANDOFF_SIBLINGS
+        sibling_loads[instance_id].clients = client_count;
+    #endif
+    /* Both the accept loop and the handoff receiver may be waiting */
+    if(client_count < max_clients)
+        client_lock.broadcastSignal();
     client_lock.unlock();
     return 0;
 }
 
-bool spawn_thread(pthread_t *thread, void *data) {
+bool spawn_thread(pthread_t *thread, void *data, void *(*routine)(void*) = handle_connection) {
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setstacksize(&attr, 64 * 1024);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    return !pthread_create(thread, &attr, handle_connection, data);
+    return !pthread_create(thread, &attr, routine, data);
+}
+
+void add_client(int clientsock) {
+    client_lock.lock();
+    client_count++;
+    #ifdef HANDOFF_SIBLINGS
+        sibling_loads[instance_id].clients = client_count;
+    #endif
+    client_lock.unlock();
+    pthread_t thread;
+    spawn_thread(&thread, (void*)(uint64_t)clientsock);
+}
+
+#ifdef HANDOFF_SIBLINGS
+string handoff_socket_path(uint32_t id) {
+    ostringstream oss;
+    oss << HANDOFF_DIR << '/' << id;
+    return oss.str();
+}
+
+/* Entries of siblings that died without cleaning up stay in the load
+ * file, so check that the process is still there. */
+bool is_sibling_alive(uint32_t id) {
+    pid_t pid = sibling_loads[id].pid;
+    return pid && (!kill(pid, 0) || errno == EPERM);
+}
+
+/* Returns the least loaded live sibling with free slots that hasn't 
+ * been tried yet, or -1 if there's none. */
+int pick_sibling(const bool *tried) {
+    int target = -1;
+    double best_load = 1.0;
+    for(uint32_t i(0); i < HANDOFF_SIBLINGS; ++i) {
+        uint32_t clients = sibling_loads[i].clients, capacity = sibling_loads[i].max_clients;
+        if(tried[i] || clients >= capacity || !is_sibling_alive(i))
+            continue;
+        double load = (double)clients / capacity;
+        if(load < best_load) {
+            best_load = load;
+            target = i;
+        }
+    }
+    return target;
+}
+
+/* Sends the socket to a sibling. Doesn't block, a sibling whose queue 
+ * is full just counts as a failure. */
+bool send_client(int sock, uint32_t target) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, handoff_socket_path(target).c_str(), sizeof(addr.sun_path) - 1);
+    char data = 0, control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &data, 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &sock, sizeof(int));
+    return sendmsg(handoff_sock, &msg, MSG_DONTWAIT) == 1;
 }
 
+/* Passes an accepted, not yet handshaken socket to the least loaded 
+ * sibling, falling back to the next one if sending fails. Returns 
+ * false if no sibling could take it. */
+bool handoff_client(int sock) {
+    bool tried[HANDOFF_SIBLINGS] = { false };
+    tried[instance_id] = true;
+    while(true) {
+        int target = pick_sibling(tried);
+        if(target == -1)
+            return false;
+        tried[target] = true;
+        if(send_client(sock, target)) {
+            close(sock);
+            return true;
+        }
+    }
+}
+
+/* Serves sockets handed off by siblings. These are never passed on
+ * again, so a client can't bounce between saturated processes. The 
+ * load figures may be stale, so a sibling can send us a client while
+ * we're full: it waits for a local slot, and meanwhile our queue fills
+ * up and the senders move on to other siblings. */
+void *receive_handoffs(void *) {
+    while(true) {
+        char data, control[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(struct ucred))];
+        struct iovec iov = { &data, 1 };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg(handoff_sock, &msg, MSG_CMSG_CLOEXEC) < 0)
+            continue;
+        int clientsock = -1;
+        bool trusted = false;
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if(cmsg->cmsg_level != SOL_SOCKET)
+                continue;
+            if(cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+                memcpy(&clientsock, CMSG_DATA(cmsg), sizeof(int));
+            else if(cmsg->cmsg_type == SCM_CREDENTIALS) {
+                struct ucred cred;
+                memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+                trusted = cred.uid == geteuid();
+            }
+        }
+        /* Only siblings running as our user may pass us clients */
+        if(clientsock == -1 || !trusted) {
+            if(clientsock != -1)
+                close(clientsock);
+            continue;
+        }
+        client_lock.lock();
+        while(client_count >= max_clients)
+            client_lock.wait();
+        client_lock.unlock();
+        add_client(clientsock);
+    }
+    return 0;
+}
+
+/* Waits for a local slot, offering the socket to the siblings in the
+ * meantime. Returns false if it was handed off. */
+bool wait_for_slot(int sock) {
+    client_lock.lock();
+    while(client_count >= max_clients) {
+        client_lock.unlock();
+        if(handoff_client(sock))
+            return false;
+        client_lock.lock();
+        if(client_count >= max_clients)
+            client_lock.timed_wait(HANDOFF_RETRY_MS);
+    }
+    client_lock.unlock();
+    return true;
+}
+
+/* Anything other users could have planted or can write to is refused */
+bool is_private(int fd, mode_t type) {
+    struct stat info;
+    return !fstat(fd, &info) && (info.st_mode & S_IFMT) == type && 
+        info.st_uid == geteuid() && !(info.st_mode & 077);
+}
+
+bool init_handoff() {
+    mkdir(HANDOFF_DIR, 0700);
+    int dir = open(HANDOFF_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if(dir < 0 || !is_private(dir, S_IFDIR)) {
+        cout << "[-] " HANDOFF_DIR " must be a directory owned by us with mode 0700\n";
+        return false;
+    }
+    int fd = openat(dir, "load", O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+    close(dir);
+    if(fd < 0 || !is_private(fd, S_IFREG)) {
+        cout << "[-] " HANDOFF_DIR "/load must be a regular file owned by us with mode 0600\n";
+        return false;
+    }
+    size_t size = sizeof(SiblingLoad) * HANDOFF_SIBLINGS;
+    void *mem = (ftruncate(fd, size) < 0) ? MAP_FAILED : mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+        return false;
+    sibling_loads = (SiblingLoad*)mem;
+    sibling_loads[instance_id].clients = 0;
+    sibling_loads[instance_id].max_clients = max_clients;
+    int one = 1;
+    if((handoff_sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 ||
+      setsockopt(handoff_sock, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) < 0)
+        return false;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, handoff_socket_path(instance_id).c_str(), sizeof(addr.sun_path) - 1);
+    unlink(addr.sun_path);
+    if(bind(handoff_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+        return false;
+    pthread_t thread;
+    if(!spawn_thread(&thread, 0, receive_handoffs))
+        return false;
+    sibling_loads[instance_id].pid = getpid();
+    return true;
+}
+#endif
+
 void parse_args(int argc, char *argv[]) {
-    if(argc == 2)
+    if(argc >= 2)
         max_clients = atoi(argv[1]);
+    #ifdef HANDOFF_SIBLINGS
+        if(argc >= 3)
+            instance_id = atoi(argv[2]) % HANDOFF_SIBLINGS;
+    #endif
 }
 
 int main(int argc, char *argv[]) {
@@ -407,19 +914,27 @@ int main(int argc, char *argv[]) {
     }
     parse_args(argc, argv);
     signal(SIGPIPE, sig_handler);
+    #ifdef HANDOFF_SIBLINGS
+        if(!init_handoff()) {
+            cout << "[-] Failed to set up sibling handoff\n";
+            return 1;
+        }
+    #endif
     while(true) {
         uint32_t clientlen = sizeof(echoclient);
         int clientsock;
-        client_lock.lock();
-        if(client_count == max_clients)
-            client_lock.wait();
-        client_lock.unlock();
-        if ((clientsock = accept(listen_sock, (struct sockaddr *) &echoclient, &clientlen)) > 0) {
+        #ifndef HANDOFF_SIBLINGS
             client_lock.lock();
-            client_count++;
+            while(client_count >= max_clients)
+                client_lock.wait();
             client_lock.unlock();
-            pthread_t thread;
-            spawn_thread(&thread, (void*)clientsock);
+        #endif
+        if ((clientsock = accept(listen_sock, (struct sockaddr *) &echoclient, &clientlen)) > 0) {
+            #ifdef HANDOFF_SIBLINGS
+                if(!wait_for_slot(clientsock))
+                    continue;
+            #endif
+            add_client(clientsock);
         }
     }
 }